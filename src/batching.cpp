@@ -0,0 +1,221 @@
+#pragma once
+#include "coinview.cpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct BatchPolicy {
+    size_t max_payments=10; // flush a sender as soon as this many payments are queued
+    std::chrono::seconds max_age{30}; // flush a sender once its oldest queued payment is this old
+};
+
+struct BatchMetrics {
+    size_t payments_queued=0;
+    size_t payments_batched=0; // payments that made it into an admitted transaction
+    size_t payments_failed=0;
+    size_t transactions_emitted=0;
+    size_t inputs_used=0;
+    double fees_paid=0;
+
+    size_t transactionsSaved() const { return payments_batched-transactions_emitted; }
+    // A one-payment transaction spends at least one input, so this is a lower bound.
+    double feesSaved() const { return std::max(0.0,payments_batched*0.001-fees_paid); }
+};
+
+struct BatchResult {
+    std::string sender;
+    size_t payments; // payments in the emitted (or failed) transaction
+    bool success;
+    std::string message;
+    std::string tx_id;
+    size_t deferred=0; // fundable alone but not alongside the batch, re-queued
+    size_t rejected=0; // unfundable even alone, dropped
+};
+
+// Collects payments per sender and emits one multi-output transaction per flush,
+// paying one change output and only the inputs the whole batch needs.
+class PaymentBatcher {
+public:
+    using Clock=std::chrono::steady_clock;
+    BatchPolicy policy;
+    BatchMetrics metrics;
+    std::function<std::pair<bool,std::string>(Transaction&)> submit; // defaults to Mempool::add_transaction
+
+    PaymentBatcher(Mempool& mempool,UTXOManager& manager,BatchPolicy policy={})
+        : policy(policy),mempool(mempool),manager(manager) {
+        submit=[this](Transaction& tx) { return this->mempool.add_transaction(tx,this->manager); };
+    }
+
+    // Non-positive amounts are rejected here so they cannot fail the sender's whole batch.
+    std::vector<BatchResult> queue(const ToPay& payment,Clock::time_point now=Clock::now()) {
+        if (payment.amount<=0) {
+            metrics.payments_failed++;
+            return {{payment.payer,1,false,"Payment amount must be positive",""}};
+        }
+        auto& q=queues[payment.payer];
+        if (q.payments.empty()) q.first_queued=now;
+        q.payments.push_back(payment);
+        metrics.payments_queued++;
+        if (q.payments.size()>=policy.max_payments) return {flush(payment.payer)};
+        return {};
+    }
+
+    // Flushes every sender whose oldest queued payment has reached the age limit.
+    std::vector<BatchResult> poll(Clock::time_point now=Clock::now()) {
+        std::vector<std::string> due;
+        for (auto const& [sender,q]:queues) {
+            if (now-q.first_queued>=policy.max_age) due.push_back(sender);
+        }
+        std::vector<BatchResult> res;
+        for (auto& sender:due) res.push_back(flush(sender));
+        return res;
+    }
+
+    std::vector<BatchResult> flushAll() {
+        std::vector<std::string> senders;
+        for (auto const& [sender,q]:queues) senders.push_back(sender);
+        std::vector<BatchResult> res;
+        for (auto& sender:senders) res.push_back(flush(sender));
+        return res;
+    }
+
+    // Emits the queued payments that the sender can fund together, in queue order. A payment
+    // that only fits on its own is re-queued for the next batch; one that cannot be funded
+    // at all is dropped, so a single oversized payment never sinks the others.
+    BatchResult flush(const std::string& sender) {
+        auto it=queues.find(sender);
+        if (it==queues.end()) return {sender,0,false,"No queued payments",""};
+        std::vector<ToPay> queued=std::move(it->second.payments);
+        Clock::time_point first_queued=it->second.first_queued;
+        queues.erase(it);
+
+        BatchResult res{sender,0,false,"",""};
+        std::vector<UTXO> owned=CoinView(manager,mempool).getAllUTXOofOwner(sender);
+        if (owned.empty()) {
+            res.payments=queued.size();
+            res.message="Sender has no UTXOs";
+            metrics.payments_failed+=queued.size();
+            return res;
+        }
+
+        std::vector<ToPay> payments,deferred;
+        double total=0;
+        for (auto& p:queued) {
+            if (fundable(owned,total+p.amount)) {
+                payments.push_back(p);
+                total+=p.amount;
+            } else if (fundable(owned,p.amount)) {
+                deferred.push_back(p);
+            } else {
+                res.rejected++;
+            }
+        }
+        metrics.payments_failed+=res.rejected;
+        res.deferred=deferred.size();
+        if (!deferred.empty()) {
+            auto& q=queues[sender];
+            q.payments=std::move(deferred);
+            q.first_queued=first_queued;
+        }
+        res.payments=payments.size();
+        if (payments.empty()) {
+            res.message="Insufficient funds";
+            return res;
+        }
+
+        Transaction tx(sender,payments,owned);
+        if (!tx.is_valid) {
+            res.message="Insufficient funds";
+        } else {
+            auto added=submit(tx);
+            res.success=added.first;
+            res.message=added.second;
+        }
+
+        if (!res.success) {
+            metrics.payments_failed+=payments.size();
+            return res;
+        }
+        res.tx_id=tx.tx_id;
+        metrics.payments_batched+=payments.size();
+        metrics.transactions_emitted++;
+        metrics.inputs_used+=tx.inputs.size();
+        metrics.fees_paid+=tx.fee;
+        return res;
+    }
+
+    // Mirrors the Transaction constructor's greedy input selection and per-input fee.
+    static bool fundable(const std::vector<UTXO>& owned,double total) {
+        const double fee_per_input=0.001;
+        double sum=0;
+        for (size_t i=0;i<owned.size();++i) {
+            sum+=owned[i].value;
+            if (sum>=total+(i+1)*fee_per_input) return true;
+        }
+        return false;
+    }
+
+    size_t pendingPayments() const {
+        size_t n=0;
+        for (auto const& [sender,q]:queues) n+=q.payments.size();
+        return n;
+    }
+
+private:
+    struct SenderQueue {
+        std::vector<ToPay> payments;
+        Clock::time_point first_queued;
+    };
+    Mempool& mempool;
+    UTXOManager& manager;
+    std::map<std::string,SenderQueue> queues;
+};
+
+// Calls PaymentBatcher::poll on a timer so the age window fires while the caller is idle.
+// The batcher is only touched with state_mutex held; results wait in a buffer for drain().
+class BatchTicker {
+public:
+    BatchTicker(PaymentBatcher& batcher,std::mutex& state_mutex,std::chrono::milliseconds interval=std::chrono::milliseconds(1000))
+        : batcher(batcher),state_mutex(state_mutex),interval(interval) {
+        worker=std::thread(&BatchTicker::run,this);
+    }
+    ~BatchTicker() {
+        {
+            std::lock_guard<std::mutex> lock(stop_mutex);
+            stop_requested=true;
+        }
+        stop_cv.notify_all();
+        worker.join();
+    }
+
+    // Must be called with state_mutex held.
+    std::vector<BatchResult> drain() {
+        std::vector<BatchResult> res;
+        res.swap(results);
+        return res;
+    }
+
+private:
+    PaymentBatcher& batcher;
+    std::mutex& state_mutex;
+    std::chrono::milliseconds interval;
+    std::vector<BatchResult> results; // guarded by state_mutex
+    std::thread worker;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cv;
+    bool stop_requested=false;
+
+    void run() {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> stop_lock(stop_mutex);
+                if (stop_cv.wait_for(stop_lock,interval,[&] { return stop_requested; })) return;
+            }
+            std::lock_guard<std::mutex> lock(state_mutex);
+            for (auto& r:batcher.poll()) results.push_back(r);
+        }
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include "mining.cpp"
+
+// Confirmed UTXO set overlaid with the mempool: outputs of pending transactions are
+// spendable, and coins already spent by a pending transaction are hidden.
+class CoinView {
+public:
+    const UTXOManager& manager;
+    const Mempool& mempool;
+
+    CoinView(const UTXOManager& manager,const Mempool& mempool) : manager(manager),mempool(mempool) {}
+
+    bool exists(const UTXO& utxo) const {
+        if (mempool.spent_by.count(utxo.id)) return false;
+        return manager.exists(utxo)||mempool.has_output(utxo);
+    }
+
+    bool isConfirmed(const UTXO& utxo) const {
+        return manager.exists(utxo);
+    }
+
+    std::vector<UTXO> getAllUTXOofOwner(const std::string& owner) const {
+        std::vector<UTXO> res;
+        for (auto const& [id,u]:manager.by_id) {
+            if (u.owner==owner&&!mempool.spent_by.count(id)) res.push_back(u);
+        }
+        for (auto const& [id,u]:mempool.pending_outputs) {
+            if (u.owner==owner&&!mempool.spent_by.count(id)) res.push_back(u);
+        }
+        std::sort(res.begin(),res.end(),[](const UTXO& a,const UTXO& b) {
+            if (a.value!=b.value) return a.value<b.value;
+            return a.id<b.id;
+        });
+        return res;
+    }
+
+    double getBalance(const std::string& owner) const {
+        double balance=0;
+        for (auto& u:getAllUTXOofOwner(owner)) balance+=u.value;
+        return balance;
+    }
+};
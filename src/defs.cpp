@@ -101,6 +101,55 @@ struct Transaction {
     }
 };
 
+uint64_t fnv1a(const std::string& s, uint64_t h = 1469598103934665603ULL) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Hash of one UTXO's fields. The UTXO set digest is the XOR of these, so it does not
+// depend on the order UTXOs were added or on how the set is partitioned.
+uint64_t hashUTXO(const UTXO& u) {
+    uint64_t h = fnv1a(u.id);
+    h = fnv1a("\xff" + u.parent_tx_id, h);
+    h = fnv1a("\xff" + u.owner, h);
+    h = fnv1a("\xff" + std::string(reinterpret_cast<const char*>(&u.value), sizeof(u.value)), h);
+    return h;
+}
+
+// Bloom filter over the owners and UTXO ids a block touches. Sized at ~10 bits per
+// element with 7 probes, which gives roughly a 1% false-positive rate.
+struct BlockFilter {
+    std::vector<uint64_t> bits;
+    int probes = 7;
+
+    void build(const std::vector<std::string>& elements) {
+        size_t words = std::max<size_t>(1, (elements.size() * 10 + 63) / 64);
+        bits.assign(words, 0);
+        for (const auto& e : elements) {
+            forEachBit(e, [this](size_t bit) { bits[bit / 64] |= 1ULL << (bit % 64); });
+        }
+    }
+
+    bool mayContain(const std::string& element) const {
+        if (bits.empty()) return false;
+        bool hit = true;
+        forEachBit(element, [&](size_t bit) { hit = hit && (bits[bit / 64] >> (bit % 64) & 1); });
+        return hit;
+    }
+
+private:
+    template <typename F>
+    void forEachBit(const std::string& element, F f) const {
+        uint64_t h1 = fnv1a(element);
+        uint64_t h2 = fnv1a(element, h1) | 1;
+        size_t m = bits.size() * 64;
+        for (int i = 0; i < probes; ++i) f((h1 + i * h2) % m);
+    }
+};
+
 struct Block {
     int height;
     std::string hash; // Simplified hash (ID)
@@ -109,4 +158,61 @@ struct Block {
     std::vector<Transaction> transactions;
     double total_fees;
     std::time_t timestamp;
+    int tx_count = 0; // survives pruning, unlike transactions.size()
+    std::string commitment; // digest of the transactions, kept after the body is pruned
+    UTXO coinbase; // miner's fee output
+    size_t utxo_count = 0; // size of the UTXO set after this block was applied
+    uint64_t utxo_digest = 0; // XOR of hashUTXO over that set
+    BlockFilter filter; // owners and UTXO ids touched, kept after pruning for wallet rescans
+    bool pruned = false;
 };
+
+// Filter over every owner and UTXO id in the block's transactions and coinbase.
+BlockFilter buildBlockFilter(const Block& block) {
+    std::vector<std::string> elements = {block.coinbase.owner, block.coinbase.id};
+    for (const auto& tx : block.transactions) {
+        for (const auto& u : tx.inputs) {
+            elements.push_back(u.owner);
+            elements.push_back(u.id);
+        }
+        for (const auto& u : tx.outputs) {
+            elements.push_back(u.owner);
+            elements.push_back(u.id);
+        }
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+    BlockFilter filter;
+    filter.build(elements);
+    return filter;
+}
+
+// FNV-1a over every transaction id, fee, input and output of a block. Amounts are hashed
+// by their raw bits, so any change to a value or fee changes the commitment.
+std::string computeCommitment(const std::vector<Transaction>& transactions) {
+    uint64_t h = fnv1a("");
+    auto mix = [&h](const std::string& s) {
+        h = fnv1a(s, h);
+        h = fnv1a("\xff", h); // field separator
+    };
+    auto mixAmount = [&mix](double v) { mix(std::string(reinterpret_cast<const char*>(&v), sizeof(v))); };
+    auto mixUTXO = [&](const UTXO& u) {
+        mix(u.id);
+        mix(u.parent_tx_id);
+        mix(u.owner);
+        mixAmount(u.value);
+    };
+    for (const auto& tx : transactions) {
+        mix(tx.tx_id);
+        mixAmount(tx.fee);
+        for (const auto& in : tx.inputs) mixUTXO(in);
+        for (const auto& out : tx.outputs) mixUTXO(out);
+    }
+    std::string chars = "0123456789abcdef";
+    std::string result(16, '0');
+    for (int i = 15; i >= 0; --i) {
+        result[i] = chars[h & 0xf];
+        h >>= 4;
+    }
+    return result;
+}
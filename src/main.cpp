@@ -1,5 +1,8 @@
-#include "mining.cpp"
+#include "miner.cpp"
+#include "batching.cpp"
+#include "rescan.cpp"
 #include "utils.hpp"
+#include <filesystem>
 #include <iomanip>
 
 int main() {
@@ -7,6 +10,29 @@ int main() {
     UTXOManager manager;
     Mempool mempool;
     std::vector<Block> blockchain;
+    // Full bodies for the last 100 blocks; older bodies are spilled to the archive for rescans
+    BlockArchive archive((std::filesystem::temp_directory_path() / "utxo_simulator_blocks.archive").string());
+    BlockPruner pruner(100, &archive);
+    BackgroundMiner miner(mempool, manager, blockchain);
+    miner.pruner = &pruner;
+    PaymentBatcher batcher(mempool, manager);
+    batcher.submit = [&](Transaction& tx) { return miner.admitLocked(tx); };
+
+    auto printBatchResults = [](const std::vector<BatchResult>& results) {
+        for (auto& r : results) {
+            if (r.success) {
+                std::cout << GREEN << " Batch: " << r.sender << " sent " << r.payments << " payments in " << r.tx_id << RESET << std::endl;
+            } else if (r.payments > 0) {
+                std::cout << RED << " Batch: " << r.sender << " dropped " << r.payments << " payments (" << r.message << ")" << RESET << std::endl;
+            }
+            if (r.deferred > 0) {
+                std::cout << YELLOW << " Batch: " << r.sender << " re-queued " << r.deferred << " payments that did not fit this batch" << RESET << std::endl;
+            }
+            if (r.rejected > 0) {
+                std::cout << RED << " Batch: " << r.sender << " dropped " << r.rejected << " payments larger than their funds" << RESET << std::endl;
+            }
+        }
+    };
 
     // Genesis state
     manager.generateUTXO("genesis",0,50.0,"Alice");
@@ -15,12 +41,32 @@ int main() {
     manager.generateUTXO("genesis",3,10.0,"David");
     manager.generateUTXO("genesis",4,5.0,"Eve");
 
+    BatchTicker ticker(batcher, miner.state_mutex); // fires the 30-second window while the menu waits for input
+
     int choice;
     while (true) {
+        std::unique_lock<std::mutex> lock(miner.state_mutex);
+        auto flushed = ticker.drain();
+        size_t queuedPayments = batcher.pendingPayments();
+        std::string pruneError = pruner.error; // the background miner prunes too
         int utxoCount = 0;
         for(auto const& [id, vec] : manager.utxo_set) utxoCount += vec.size();
         
         printHeader(blockchain.size(), mempool.transactions.size(), utxoCount);
+        lock.unlock();
+        if (!pruneError.empty()) std::cout << RED << " Pruning stalled: " << pruneError << RESET << std::endl;
+        printBatchResults(flushed);
+
+        for (auto& ev : miner.pollEvents()) {
+            if (ev.type == MinerEventType::BlockFound) {
+                std::cout << GREEN << " Miner: block #" << ev.height << " found [" << ev.block_hash << "] with "
+                          << ev.tx_count << " txs, " << ev.total_fees << " BTC fees" << RESET << std::endl;
+            } else if (ev.type == MinerEventType::TemplateRefreshed) {
+                std::cout << CYAN << " Miner: template refreshed (" << ev.tx_count << " txs)" << RESET << std::endl;
+            } else {
+                std::cout << YELLOW << " Miner: template stale, rebuilt on new tip" << RESET << std::endl;
+            }
+        }
 
         std::cout << BOLD << "\nActions:" << RESET << std::endl;
         std::cout << " " << GREEN << "1." << RESET << " Create transaction\n";
@@ -28,7 +74,12 @@ int main() {
         std::cout << " " << GREEN << "3." << RESET << " View mempool\n";
         std::cout << " " << GREEN << "4." << RESET << " Mine block\n";
         std::cout << " " << GREEN << "5." << RESET << " View Blockchain (History)\n";
-        std::cout << " " << RED   << "6." << RESET << " Exit\n";
+        std::cout << " " << GREEN << "6." << RESET << " "
+                  << (miner.running() ? "Stop background miner (" + miner.minerAddress() + ")" : "Start background miner") << "\n";
+        std::cout << " " << GREEN << "7." << RESET << " Queue batched payment (" << queuedPayments << " queued)\n";
+        std::cout << " " << GREEN << "8." << RESET << " Flush payment batches\n";
+        std::cout << " " << GREEN << "9." << RESET << " Rescan wallet from blocks\n";
+        std::cout << " " << RED   << "10." << RESET << " Exit\n";
         std::cout << "\n" << CYAN << "Enter choice: " << RESET;
         
         if (!(std::cin>>choice)) {
@@ -37,7 +88,7 @@ int main() {
             continue;
         }
 
-        if (choice==6) break;
+        if (choice==10) break;
 
         std::cout << "\n--------------------------------------------\n";
         if (choice == 1) {
@@ -46,7 +97,9 @@ int main() {
             std::cout << "Recipient: "; std::cin >> r;
             std::cout << "Amount: "; std::cin >> a;
             
-            std::vector<UTXO> owned = manager.getAllUTXOofOwner(s);
+            lock.lock();
+            // Includes change and payments from pending transactions, so chained spends work
+            std::vector<UTXO> owned = CoinView(manager, mempool).getAllUTXOofOwner(s);
             
             if (owned.empty()) {
                 std::cout << RED << "Sender has no UTXOs!" << RESET << std::endl;
@@ -55,7 +108,8 @@ int main() {
                 Transaction tx(s, payments, owned);
 
                 if (tx.is_valid) {
-                    auto res = mempool.add_transaction(tx, manager);
+                    lock.unlock();
+                    auto res = miner.submit(tx);
                     if(res.first) std::cout << GREEN << res.second << RESET << std::endl;
                     else std::cout << RED << "Mempool Error: " << res.second << RESET << std::endl;
                 } else {
@@ -71,6 +125,7 @@ int main() {
             
             int sortChoice;
             std::cin >> sortChoice;
+            lock.lock();
 
             std::cout << "\n" << BOLD << "Current UTXO Set:" << RESET << std::endl;
 
@@ -110,6 +165,7 @@ int main() {
             }
 
         } else if (choice==3) {
+            lock.lock();
             std::cout << BOLD << "Mempool Transactions:" << RESET << std::endl;
             if (mempool.transactions.empty()) std::cout << " (Empty)" << std::endl;
             for (auto& tx:mempool.transactions) {
@@ -119,22 +175,80 @@ int main() {
         } else if (choice==4) {
             std::string m;
             std::cout << "Miner Name/Address: "; std::cin >> m;
-            mine_block(m, mempool, manager, blockchain);
+            lock.lock();
+            mine_block(m, mempool, manager, blockchain, &pruner);
+            miner.notifyNewTip();
 
         } else if (choice==5) {
+            lock.lock();
             std::cout << BOLD << "Blockchain History:" << RESET << std::endl;
             if (blockchain.empty()) std::cout << " (No blocks mined yet)" << std::endl;
             
             for(const auto& block : blockchain) {
-                std::cout << MAGENTA << "Block #" << block.height << RESET << " [" << block.hash << "]\n";
+                std::cout << MAGENTA << "Block #" << block.height << RESET << " [" << block.hash << "]"
+                          << (block.pruned ? YELLOW + " (pruned)" + RESET : "") << "\n";
                 std::cout << "  Miner: " << block.miner << "\n";
                 std::cout << "  Prev Hash: " << block.prev_hash << "\n";
-                std::cout << "  Tx Count: " << block.transactions.size() << "\n";
+                std::cout << "  Commitment: " << block.commitment << "\n";
+                std::cout << "  Tx Count: " << block.tx_count << "\n";
                 std::cout << "  Total Fees: " << block.total_fees << "\n";
                 std::cout << "--------------------------------------------\n";
             }
+        } else if (choice==6) {
+            if (miner.running()) {
+                miner.stop();
+                std::cout << YELLOW << "Background miner stopped." << RESET << std::endl;
+            } else {
+                std::string m;
+                std::cout << "Miner Name/Address: "; std::cin >> m;
+                miner.start(m);
+                std::cout << GREEN << "Background miner started. Keep creating transactions while it works." << RESET << std::endl;
+            }
+        } else if (choice==7) {
+            std::string s, r; double a;
+            std::cout << "Sender: "; std::cin >> s;
+            std::cout << "Recipient: "; std::cin >> r;
+            std::cout << "Amount: "; std::cin >> a;
+
+            lock.lock();
+            auto results = batcher.queue({s, r, a});
+            if (results.empty()) std::cout << GREEN << "Payment queued for " << s << "'s next batch" << RESET << std::endl;
+            printBatchResults(results);
+
+        } else if (choice==8) {
+            lock.lock();
+            printBatchResults(batcher.flushAll());
+            const BatchMetrics& m = batcher.metrics;
+            std::cout << BOLD << "\nBatching Metrics:" << RESET << std::endl;
+            std::cout << "  Payments Queued: " << m.payments_queued << "\n";
+            std::cout << "  Payments Batched: " << m.payments_batched << " (" << m.payments_failed << " failed)\n";
+            std::cout << "  Transactions Emitted: " << m.transactions_emitted << "\n";
+            std::cout << "  Transactions Saved: " << GREEN << m.transactionsSaved() << RESET << "\n";
+            std::cout << "  Inputs Used: " << m.inputs_used << "\n";
+            std::cout << "  Fees Paid: " << m.fees_paid << " BTC (saved at least " << m.feesSaved() << " BTC)\n";
+        } else if (choice==9) {
+            std::string o;
+            std::cout << "Owner: "; std::cin >> o;
+
+            lock.lock();
+            RescanResult scan;
+            auto res = rescan_wallet(blockchain, {o}, scan, &archive);
+            if (!res.first) {
+                std::cout << RED << "Rescan Error: " << res.second << RESET << std::endl;
+            } else {
+                std::cout << BOLD << "Coins of " << o << " received in blocks:" << RESET << std::endl;
+                if (scan.unspent.empty()) std::cout << " (None)" << std::endl;
+                for (const auto& u : scan.unspent) {
+                    std::cout << " - " << YELLOW << u.value << " BTC" << RESET << " | " << u.id << " (Tx: " << u.parent_tx_id << ")" << std::endl;
+                }
+                std::cout << "  Balance: " << scan.balance << " BTC\n";
+                std::cout << "  Blocks Decoded: " << scan.blocks_matched << " of " << scan.blocks_checked
+                          << " (" << scan.false_positives << " false positives)\n";
+                if (!scan.skipped.empty()) std::cout << YELLOW << "  Warning: " << res.second << RESET << "\n";
+            }
         }
 
+        if (lock.owns_lock()) lock.unlock();
         waitForEnter();
     }
     return 0;
@@ -0,0 +1,181 @@
+#pragma once
+#include "mining.cpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+enum class MinerEventType { BlockFound, TemplateRefreshed, TemplateStale };
+
+struct MinerEvent {
+    MinerEventType type;
+    int height;
+    std::string block_hash;
+    size_t tx_count;
+    double total_fees;
+};
+
+// Mines on a worker thread. The state lock is only held while a template is built,
+// refreshed or committed, so transaction admission never waits on the hash search.
+class BackgroundMiner {
+public:
+    std::mutex state_mutex; // guards mempool, manager and blockchain while the worker runs
+    std::atomic<uint64_t> difficulty{2000000}; // expected hash attempts per block
+    int attempts_per_round=5000;
+    BlockPruner* pruner=nullptr; // applied to the chain after every block the worker commits
+    std::function<void(const MinerEvent&)> on_event; // called from the worker with state_mutex held; events are queued when unset
+
+    BackgroundMiner(Mempool& mempool,UTXOManager& manager,std::vector<Block>& blockchain)
+        : mempool(mempool),manager(manager),blockchain(blockchain) {}
+    ~BackgroundMiner() { stop(); }
+
+    void start(const std::string& miner_address) {
+        if (worker.joinable()) return;
+        address=miner_address;
+        stop_requested=false;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            pending.clear();
+            tip_changed=true;
+        }
+        worker=std::thread(&BackgroundMiner::run,this);
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            stop_requested=true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    bool running() const { return worker.joinable(); }
+    const std::string& minerAddress() const { return address; }
+
+    std::pair<bool,std::string> submit(Transaction& tx) {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        return admitLocked(tx);
+    }
+
+    // Same as submit() for callers that already hold state_mutex.
+    std::pair<bool,std::string> admitLocked(Transaction& tx) {
+        auto res=mempool.add_transaction(tx,manager);
+        if (res.first&&running()) {
+            pending.push_back(tx);
+            wake.notify_all();
+        }
+        return res;
+    }
+
+    // Must be called with state_mutex held after the chain changed outside the worker.
+    void notifyNewTip() {
+        tip_changed=true;
+        wake.notify_all();
+    }
+
+    std::vector<MinerEvent> pollEvents() {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        std::vector<MinerEvent> res(events.begin(),events.end());
+        events.clear();
+        return res;
+    }
+
+private:
+    Mempool& mempool;
+    UTXOManager& manager;
+    std::vector<Block>& blockchain;
+    std::string address;
+    std::thread worker;
+    bool stop_requested=false;
+    bool tip_changed=false;
+    std::vector<Transaction> pending; // admitted since the template was last refreshed
+    std::condition_variable wake;
+    std::mutex events_mutex;
+    std::deque<MinerEvent> events;
+
+    static MinerEvent describe(MinerEventType type,const BlockTemplate& tmpl,const std::string& hash="") {
+        return {type,tmpl.height,hash,tmpl.transactions.size(),tmpl.total_fees};
+    }
+
+    void emit(const MinerEvent& ev) {
+        if (on_event) {
+            on_event(ev);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events.push_back(ev);
+    }
+
+    // Pending transactions passed the first-seen check against the whole mempool, so they
+    // only need their inputs to be confirmed or created earlier in the template.
+    bool refresh(BlockTemplate& tmpl) {
+        if (pending.empty()) return false;
+        for (auto& tx:pending) {
+            bool can_mine=true;
+            for (auto& in:tx.inputs) {
+                if (!tmpl.can_spend(in,manager)) {
+                    can_mine=false;
+                    break;
+                }
+            }
+            if (can_mine) tmpl.add(tx);
+        }
+        pending.clear();
+        return true;
+    }
+
+    void run() {
+        BlockTemplate tmpl;
+        uint64_t nonce=0;
+        std::hash<std::string> hasher;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(state_mutex);
+                wake.wait(lock,[&] {
+                    return stop_requested||tip_changed||!pending.empty()||!tmpl.transactions.empty();
+                });
+                if (stop_requested) return;
+                if (tip_changed) {
+                    bool had_work=!tmpl.transactions.empty();
+                    MinerEvent stale=describe(MinerEventType::TemplateStale,tmpl);
+                    tip_changed=false;
+                    pending.clear();
+                    tmpl=build_template(mempool,manager,blockchain);
+                    nonce=0;
+                    if (had_work) emit(stale);
+                    else if (!tmpl.transactions.empty()) emit(describe(MinerEventType::TemplateRefreshed,tmpl));
+                } else if (refresh(tmpl)) {
+                    emit(describe(MinerEventType::TemplateRefreshed,tmpl));
+                }
+            }
+            if (tmpl.transactions.empty()) continue;
+
+            bool found=false;
+            uint64_t target=std::max<uint64_t>(1,difficulty.load());
+            std::string prefix=tmpl.prev_hash+std::to_string(tmpl.transactions.size())+":";
+            for (int i=0;i<attempts_per_round&&!found;++i) {
+                found=hasher(prefix+std::to_string(nonce++))%target==0;
+            }
+            if (!found) continue;
+
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (stop_requested) return;
+            std::string tip=(blockchain.empty()) ? "0000000000" : blockchain.back().hash;
+            if (tip_changed||tip!=tmpl.prev_hash) {
+                tip_changed=true;
+                continue;
+            }
+            // Commit exactly the template the nonce was found for; transactions admitted
+            // meanwhile are still in the mempool and go into the next template.
+            Block block=commit_block(address,tmpl,mempool,manager,blockchain,pruner);
+            emit(describe(MinerEventType::BlockFound,tmpl,block.hash));
+            pending.clear();
+            tmpl=build_template(mempool,manager,blockchain);
+            nonce=0;
+        }
+    }
+};
@@ -1,27 +1,31 @@
 #pragma once
 #include "utxo.cpp"
+#include "storage.cpp"
+#include <functional>
 #include <iostream>
+#include <unordered_set>
 class Mempool {
 public:
     std::vector<Transaction> transactions;
     int max_size=50;
+    std::unordered_map<std::string,UTXO> pending_outputs; // outputs created by pending transactions
+    std::unordered_map<std::string,std::string> spent_by; // input UTXO id -> pending tx_id spending it
+
+    bool has_output(const UTXO& utxo) const {
+        auto it=pending_outputs.find(utxo.id);
+        return it!=pending_outputs.end()&&it->second==utxo;
+    }
 
     std::pair<bool,std::string> add_transaction(Transaction& tx,UTXOManager& manager) {
         if (transactions.size()>=max_size) return {false,"Mempool full"};
         double total_in=0;
         std::set<std::string> local_inputs;
         for (auto& in:tx.inputs) {
-            if (!manager.exists(in)) return {false,"Input UTXO does not exist"};
+            if (!manager.exists(in)&&!has_output(in)) return {false,"Input UTXO does not exist"};
             if (local_inputs.count(in.id)) return {false,"Double-spend in same TX"};
 
             //checking mempool for repeated UTXO being spent in another transaction 
-            for (const auto& existing_tx : transactions) {
-                for (const auto& existing_in : existing_tx.inputs) {
-                    if (existing_in.id == in.id) {
-                        return {false, "Double-spend: Input already pending in mempool"};
-                    }
-                }
-            }
+            if (spent_by.count(in.id)) return {false, "Double-spend: Input already pending in mempool"};
 
             local_inputs.insert(in.id);
             total_in+=in.value;
@@ -35,59 +39,156 @@ public:
         tx.fee=total_in-total_out;
         tx.is_valid=true;
         transactions.push_back(tx);
+        for (auto& in:tx.inputs) spent_by[in.id]=tx.tx_id;
+        for (auto& out:tx.outputs) pending_outputs[out.id]=out;
         return {true,"Success"};
     }
+
+    // Drops transactions whose inputs are neither confirmed nor created by a remaining
+    // pending transaction, repeating until descendants of dropped transactions are gone too.
+    void evict_invalid(UTXOManager& manager) {
+        bool removed=true;
+        while (removed) {
+            reindex();
+            auto it=std::remove_if(transactions.begin(),transactions.end(),[&](const Transaction& tx) {
+                for (auto& in:tx.inputs) {
+                    if (!manager.exists(in)&&!has_output(in)) return true;
+                }
+                return false;
+            });
+            removed=it!=transactions.end();
+            transactions.erase(it,transactions.end());
+        }
+    }
+
+    void reindex() {
+        pending_outputs.clear();
+        spent_by.clear();
+        for (auto& tx:transactions) {
+            for (auto& in:tx.inputs) spent_by[in.id]=tx.tx_id;
+            for (auto& out:tx.outputs) pending_outputs[out.id]=out;
+        }
+    }
 };
 
-void mine_block(std::string miner_address, Mempool& mempool, UTXOManager& manager, std::vector<Block>& blockchain) {
-    if (mempool.transactions.empty()) {
-        std::cout << YELLOW << "Mempool is empty. No transactions to mine." << RESET << std::endl;
-        return;
+struct BlockTemplate {
+    int height=0;
+    std::string prev_hash;
+    std::vector<Transaction> transactions;
+    std::set<std::string> spent_ids;
+    std::unordered_set<std::string> created_ids; // outputs of transactions already in the template
+    double total_fees=0;
+
+    bool can_spend(const UTXO& in,const UTXOManager& manager) const {
+        return !spent_ids.count(in.id)&&(manager.exists(in)||created_ids.count(in.id));
     }
 
+    void add(const Transaction& tx) {
+        for (auto& in:tx.inputs) spent_ids.insert(in.id);
+        for (auto& out:tx.outputs) created_ids.insert(out.id);
+        total_fees+=tx.fee;
+        transactions.push_back(tx);
+    }
+};
+
+// Highest-fee-first selection of mempool transactions whose inputs are still unspent.
+// A transaction spending another pending transaction's output waits until its parent is
+// selected, so dependent chains land in one block in spendable order.
+BlockTemplate build_template(Mempool& mempool, UTXOManager& manager, const std::vector<Block>& blockchain,
+                             std::vector<std::string>* rejected=nullptr) {
+    BlockTemplate tmpl;
+    tmpl.height=blockchain.size()+1;
+    tmpl.prev_hash=(blockchain.empty()) ? "0000000000" : blockchain.back().hash;
+
     std::sort(mempool.transactions.begin(),mempool.transactions.end(),[](const Transaction& a,const Transaction& b) {
         return a.fee>b.fee;
     });
 
-    double total_fees=0;
-    std::set<std::string> block_spent_ids;
-    std::vector<Transaction> valid_txs;
-
-    for (auto& tx:mempool.transactions) {
-        bool can_mine=true;
+    std::unordered_map<std::string,std::vector<const Transaction*>> waiting; // parent output id -> children
+    std::unordered_set<std::string> selected;
+    std::function<void(const Transaction&)> try_add=[&](const Transaction& tx) {
+        if (selected.count(tx.tx_id)) return;
         for (auto& in:tx.inputs) {
-            if (!manager.exists(in)||block_spent_ids.count(in.id)) {
-                can_mine=false;
-                break;
+            if (!tmpl.can_spend(in,manager)) {
+                if (!tmpl.spent_ids.count(in.id)&&mempool.has_output(in)) waiting[in.id].push_back(&tx);
+                return;
             }
         }
-        if (can_mine) {
-            for (auto& in:tx.inputs) {
-                manager.consumeUTXO(in);
-                block_spent_ids.insert(in.id);
-            }
-            for (int i=0;i<tx.outputs.size();++i) {
-                manager.generateUTXO(tx.tx_id,i,tx.outputs[i].value,tx.outputs[i].owner);
-            }
-            total_fees+=tx.fee;
-            valid_txs.push_back(tx);
-        } else {
-            std::cout << RED << "TX "<<tx.tx_id<<" rejected (UTXO spent)" << RESET << std::endl;
+        tmpl.add(tx);
+        selected.insert(tx.tx_id);
+        for (auto& out:tx.outputs) {
+            auto it=waiting.find(out.id);
+            if (it==waiting.end()) continue;
+            auto children=std::move(it->second);
+            waiting.erase(it);
+            for (auto* child:children) try_add(*child);
+        }
+    };
+    for (auto& tx:mempool.transactions) try_add(tx);
+
+    if (rejected) {
+        for (auto& tx:mempool.transactions) {
+            if (!selected.count(tx.tx_id)) rejected->push_back(tx.tx_id);
         }
     }
+    return tmpl;
+}
+
+// Applies a template on top of the current tip and drops mined or now-invalid transactions from the mempool.
+Block commit_block(const std::string& miner_address, const BlockTemplate& tmpl, Mempool& mempool,
+                   UTXOManager& manager, std::vector<Block>& blockchain, BlockPruner* pruner=nullptr) {
+    std::set<std::string> mined_ids;
+    for (auto& tx:tmpl.transactions) {
+        for (auto& in:tx.inputs) manager.consumeUTXO(in);
+        for (auto& out:tx.outputs) manager.addUTXO(out);
+        mined_ids.insert(tx.tx_id);
+    }
 
     Block newBlock;
-    newBlock.height = blockchain.size() + 1;
+    newBlock.height = tmpl.height;
     newBlock.miner = miner_address;
-    newBlock.transactions = valid_txs;
-    newBlock.total_fees = total_fees;
+    newBlock.transactions = tmpl.transactions;
+    newBlock.total_fees = tmpl.total_fees;
     newBlock.timestamp = std::time(nullptr);
-    newBlock.prev_hash = (blockchain.empty()) ? "0000000000" : blockchain.back().hash;
+    newBlock.prev_hash = tmpl.prev_hash;
     newBlock.hash = genBlockHash(newBlock.height);
+    newBlock.tx_count = tmpl.transactions.size();
+    newBlock.commitment = computeCommitment(tmpl.transactions);
 
-    manager.generateUTXO(genUniqueUTXOID(),0,total_fees,miner_address);
+    std::string coinbase_tx=genUniqueUTXOID();
+    newBlock.coinbase={genUniqueUTXOID(),coinbase_tx,miner_address,tmpl.total_fees};
+    manager.addUTXO(newBlock.coinbase);
+    newBlock.utxo_count=manager.by_id.size();
+    newBlock.utxo_digest=manager.digest;
+    newBlock.filter=buildBlockFilter(newBlock);
     blockchain.push_back(newBlock);
-    mempool.transactions.clear();
+    if (pruner) pruner->prune(blockchain);
+
+    auto& txs=mempool.transactions;
+    txs.erase(std::remove_if(txs.begin(),txs.end(),[&](const Transaction& tx) {
+        return mined_ids.count(tx.tx_id)>0;
+    }),txs.end());
+    mempool.evict_invalid(manager);
+    return newBlock;
+}
+
+void mine_block(std::string miner_address, Mempool& mempool, UTXOManager& manager, std::vector<Block>& blockchain,
+                BlockPruner* pruner=nullptr) {
+    if (mempool.transactions.empty()) {
+        std::cout << YELLOW << "Mempool is empty. No transactions to mine." << RESET << std::endl;
+        return;
+    }
+
+    std::vector<std::string> rejected;
+    BlockTemplate tmpl=build_template(mempool,manager,blockchain,&rejected);
+    for (auto& id:rejected) {
+        std::cout << RED << "TX "<<id<<" rejected (UTXO spent)" << RESET << std::endl;
+    }
+
+    commit_block(miner_address,tmpl,mempool,manager,blockchain,pruner);
     
-    std::cout << GREEN << BOLD << "Block mined! Miner "<<miner_address<<" earned "<<total_fees<<" BTC" << RESET << std::endl;
+    std::cout << GREEN << BOLD << "Block mined! Miner "<<miner_address<<" earned "<<tmpl.total_fees<<" BTC" << RESET << std::endl;
+    if (pruner&&!pruner->error.empty()) {
+        std::cout << RED << "Pruning stalled: "<<pruner->error << RESET << std::endl;
+    }
 }
@@ -0,0 +1,208 @@
+#pragma once
+#include "utxo.cpp"
+#include "storage.cpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct ReindexStats {
+    size_t blocks = 0;
+    size_t created = 0;
+    size_t spent = 0;
+    unsigned shards = 0;
+};
+
+// Rebuilds the UTXO set from genesis outputs plus a chain of blocks, in two parallel stages.
+// Checker threads claim chunks of consecutive blocks, load pruned bodies from the archive,
+// check them against the resident header and commitment, and split their creations and
+// spends by UTXO id into one batch per shard. Shard workers apply their batch of every
+// chunk in chain order, so each outpoint is only ever touched by one thread. Checkers
+// stay at most a few chunks ahead of the slowest shard, which bounds memory.
+// Shards fail on a spend of a missing UTXO. The per-block UTXO count check uses counts
+// derived from the block bodies; the rebuilt set itself is checked at the end, by size
+// and by XOR-combining each shard's digest against the tip block's utxo_digest.
+std::pair<bool,std::string> reindex_chain(const std::vector<Block>& blockchain, const std::vector<UTXO>& genesis,
+                                          UTXOManager& manager, const BlockArchive* archive = nullptr,
+                                          unsigned threads = 0, ReindexStats* stats = nullptr) {
+    struct Op {
+        bool spend;
+        UTXO utxo;
+    };
+    using Batch = std::vector<Op>;
+    struct Chunk {
+        std::vector<Batch> shards; // this chunk's ops for each shard, in chain order
+        std::vector<long long> deltas; // UTXO count change of each block
+        bool ready = false;
+    };
+    const size_t chunk_blocks = 64;
+
+    unsigned shard_count = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk_count = (blockchain.size() + chunk_blocks - 1) / chunk_blocks;
+    const size_t window = 2 * shard_count; // chunks checked ahead of the slowest shard
+    std::hash<std::string> hasher;
+    auto shard_of = [&](const std::string& id) { return hasher(id) % shard_count; };
+
+    // Guarded by mutex: chunk ready flags, shard_done, first_failed and the error slots.
+    // Work stops above the lowest failing chunk but always finishes below it, so the
+    // reported error is the first one in chain order however the threads interleave.
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<Chunk> chunks(chunk_count);
+    std::vector<std::string> errors(chunk_count);
+    std::vector<unsigned> error_shard(chunk_count, shard_count); // shard_count marks a checker error
+    std::vector<size_t> shard_done(shard_count, 0); // chunks each shard has applied
+    size_t first_failed = chunk_count;
+    ReindexStats local;
+    local.shards = shard_count;
+
+    std::vector<std::unordered_map<std::string,UTXO>> shard_sets(shard_count);
+    std::vector<uint64_t> shard_digests(shard_count, 0);
+    for (auto& utxo : genesis) shard_sets[shard_of(utxo.id)][utxo.id] = utxo;
+
+    std::atomic<size_t> next_chunk{0};
+    auto check = [&] {
+        while (true) {
+            size_t c = next_chunk++;
+            if (c >= chunk_count) return;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] {
+                    return c > first_failed || c < *std::min_element(shard_done.begin(), shard_done.end()) + window;
+                });
+                if (c > first_failed) return;
+            }
+            Chunk chunk;
+            chunk.shards.resize(shard_count);
+            std::string error;
+            size_t spent = 0, created = 0;
+            for (size_t i = c * chunk_blocks; i < std::min(blockchain.size(), (c + 1) * chunk_blocks); ++i) {
+                const Block& header = blockchain[i];
+                const Block* block = &header;
+                Block loaded;
+                if (header.pruned) {
+                    if (!archive || !archive->load(header.height, loaded)) {
+                        error = "Body of pruned block #" + std::to_string(header.height) + " is not archived";
+                        break;
+                    }
+                    if (loaded.hash != header.hash || loaded.prev_hash != header.prev_hash
+                        || !(loaded.coinbase == header.coinbase) || loaded.utxo_count != header.utxo_count
+                        || loaded.utxo_digest != header.utxo_digest) {
+                        error = "Archived block #" + std::to_string(header.height) + " does not match its header";
+                        break;
+                    }
+                    block = &loaded;
+                }
+                if (block->prev_hash != (i ? blockchain[i - 1].hash : "0000000000")) {
+                    error = "Block #" + std::to_string(block->height) + " does not link to its parent";
+                    break;
+                }
+                if (computeCommitment(block->transactions) != header.commitment) {
+                    error = "Block #" + std::to_string(block->height) + " does not match its commitment";
+                    break;
+                }
+                long long delta = 1;
+                for (auto& tx : block->transactions) {
+                    for (auto& in : tx.inputs) chunk.shards[shard_of(in.id)].push_back({true, in});
+                    for (auto& out : tx.outputs) chunk.shards[shard_of(out.id)].push_back({false, out});
+                    spent += tx.inputs.size();
+                    created += tx.outputs.size();
+                    delta += (long long)tx.outputs.size() - (long long)tx.inputs.size();
+                }
+                chunk.shards[shard_of(block->coinbase.id)].push_back({false, block->coinbase});
+                created++;
+                chunk.deltas.push_back(delta);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error.empty()) {
+                errors[c] = error;
+                first_failed = std::min(first_failed, c);
+            } else {
+                chunks[c] = std::move(chunk);
+                chunks[c].ready = true;
+                local.blocks += chunks[c].deltas.size();
+                local.spent += spent;
+                local.created += created;
+            }
+            changed.notify_all();
+        }
+    };
+
+    auto apply = [&](unsigned s) {
+        auto& set = shard_sets[s];
+        for (size_t c = 0; c < chunk_count; ++c) {
+            Batch batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return c >= first_failed || chunks[c].ready; });
+                if (c >= first_failed) return;
+                batch = std::move(chunks[c].shards[s]);
+            }
+            for (auto& op : batch) {
+                if (!op.spend) {
+                    set[op.utxo.id] = op.utxo;
+                    continue;
+                }
+                auto it = set.find(op.utxo.id);
+                if (it == set.end() || !(it->second == op.utxo)) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (s < error_shard[c]) {
+                        errors[c] = "Spent UTXO " + op.utxo.id + " does not exist";
+                        error_shard[c] = s;
+                    }
+                    first_failed = std::min(first_failed, c);
+                    changed.notify_all();
+                    return;
+                }
+                set.erase(it);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            shard_done[s] = c + 1;
+            changed.notify_all();
+        }
+        for (auto& [id, utxo] : set) shard_digests[s] ^= hashUTXO(utxo);
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < shard_count; ++i) {
+        workers.emplace_back(check);
+        workers.emplace_back(apply, i);
+    }
+    for (auto& w : workers) w.join();
+    if (stats) *stats = local;
+
+    // Per chunk, in chain order: checker errors, then UTXO counts, then shard errors.
+    long long expected_count = genesis.size();
+    for (size_t c = 0; c < chunk_count; ++c) {
+        if (!errors[c].empty() && error_shard[c] == shard_count) return {false, errors[c]};
+        for (size_t j = 0; j < chunks[c].deltas.size(); ++j) {
+            const Block& header = blockchain[c * chunk_blocks + j];
+            expected_count += chunks[c].deltas[j];
+            if (expected_count != (long long)header.utxo_count) {
+                return {false, "Block #" + std::to_string(header.height) + " UTXO count mismatch (recorded "
+                             + std::to_string(header.utxo_count) + ", rebuilt " + std::to_string(expected_count) + ")"};
+            }
+        }
+        if (!errors[c].empty()) return {false, errors[c]};
+    }
+
+    size_t total = 0;
+    for (auto& set : shard_sets) total += set.size();
+    if ((long long)total != expected_count) return {false, "Rebuilt UTXO set size does not match the chain"};
+    uint64_t digest = 0;
+    for (auto d : shard_digests) digest ^= d;
+    if (!blockchain.empty() && digest != blockchain.back().utxo_digest) {
+        return {false, "Rebuilt UTXO set does not match the digest of block #" + std::to_string(blockchain.back().height)};
+    }
+
+    manager.utxo_set.clear();
+    manager.by_id.clear();
+    manager.digest = 0;
+    manager.by_id.reserve(total);
+    for (auto& set : shard_sets) {
+        for (auto& [id, utxo] : set) manager.addUTXO(utxo);
+    }
+    return {true, "Success"};
+}
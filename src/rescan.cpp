@@ -0,0 +1,74 @@
+#pragma once
+#include "storage.cpp"
+
+struct RescanResult {
+    std::vector<UTXO> unspent; // wallet coins created in blocks and still unspent at the tip
+    double balance = 0;
+    size_t blocks_checked = 0;
+    size_t blocks_matched = 0; // filter said maybe
+    size_t false_positives = 0; // matched, but no wallet owner in the body
+    std::vector<int> skipped; // heights of matching blocks whose pruned body is not archived
+};
+
+// Finds the coins of a set of owners by testing each block's filter and decoding only the
+// blocks that match; pruned bodies are read back from the archive. Matching blocks whose
+// body is gone are listed in skipped, and the result then misses their coins.
+std::pair<bool,std::string> rescan_wallet(const std::vector<Block>& blockchain, const std::set<std::string>& owners,
+                                          RescanResult& result, const BlockArchive* archive = nullptr) {
+    result = RescanResult();
+    std::unordered_map<std::string,UTXO> coins;
+    std::vector<std::string> order; // creation order, for stable output
+    for (const auto& header : blockchain) {
+        result.blocks_checked++;
+        bool match = false;
+        for (const auto& owner : owners) {
+            if (header.filter.mayContain(owner)) {
+                match = true;
+                break;
+            }
+        }
+        if (!match) continue;
+        result.blocks_matched++;
+
+        Block loaded;
+        const Block* block = &header;
+        if (header.pruned) {
+            if (!archive || !archive->load(header.height, loaded)) {
+                result.skipped.push_back(header.height);
+                continue;
+            }
+            block = &loaded;
+        }
+
+        bool touched = false;
+        auto receive = [&](const UTXO& u) {
+            if (!owners.count(u.owner)) return;
+            coins[u.id] = u;
+            order.push_back(u.id);
+            touched = true;
+        };
+        for (const auto& tx : block->transactions) {
+            for (const auto& in : tx.inputs) {
+                if (owners.count(in.owner)) {
+                    coins.erase(in.id);
+                    touched = true;
+                }
+            }
+            for (const auto& out : tx.outputs) receive(out);
+        }
+        receive(block->coinbase);
+        if (!touched) result.false_positives++;
+    }
+
+    for (const auto& id : order) {
+        auto it = coins.find(id);
+        if (it == coins.end()) continue;
+        result.unspent.push_back(it->second);
+        result.balance += it->second.value;
+        coins.erase(it);
+    }
+    if (!result.skipped.empty()) {
+        return {true, std::to_string(result.skipped.size()) + " pruned blocks could not be scanned"};
+    }
+    return {true, "Success"};
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "defs.cpp"
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+// Line-based block encoding. Names and ids are read with >>, so they must not contain whitespace.
+void writeUTXO(std::ostream& out, const UTXO& u) {
+    out << u.id << ' ' << u.parent_tx_id << ' ' << u.owner << ' ' << u.value << '\n';
+}
+
+bool readUTXO(std::istream& in, UTXO& u) {
+    return bool(in >> u.id >> u.parent_tx_id >> u.owner >> u.value);
+}
+
+void writeBlock(std::ostream& out, const Block& block) {
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    out << "B " << block.height << ' ' << block.hash << ' ' << block.prev_hash << ' ' << block.miner << ' '
+        << block.timestamp << ' ' << block.total_fees << ' ' << block.transactions.size() << ' '
+        << block.commitment << ' ' << block.utxo_count << ' ' << block.utxo_digest << '\n';
+    writeUTXO(out, block.coinbase);
+    for (const auto& tx : block.transactions) {
+        out << "T " << tx.tx_id << ' ' << tx.fee << ' ' << tx.inputs.size() << ' ' << tx.outputs.size() << '\n';
+        for (const auto& u : tx.inputs) writeUTXO(out, u);
+        for (const auto& u : tx.outputs) writeUTXO(out, u);
+    }
+}
+
+bool readBlock(std::istream& in, Block& block) {
+    std::string tag;
+    size_t tx_count;
+    if (!(in >> tag) || tag != "B") return false;
+    if (!(in >> block.height >> block.hash >> block.prev_hash >> block.miner >> block.timestamp
+             >> block.total_fees >> tx_count >> block.commitment >> block.utxo_count >> block.utxo_digest)) return false;
+    if (!readUTXO(in, block.coinbase)) return false;
+    block.tx_count = tx_count;
+    block.pruned = false;
+    block.transactions.assign(tx_count, Transaction());
+    for (auto& tx : block.transactions) {
+        size_t n_in, n_out;
+        if (!(in >> tag >> tx.tx_id >> tx.fee >> n_in >> n_out) || tag != "T") return false;
+        tx.is_valid = true;
+        tx.inputs.resize(n_in);
+        tx.outputs.resize(n_out);
+        for (auto& u : tx.inputs) if (!readUTXO(in, u)) return false;
+        for (auto& u : tx.outputs) if (!readUTXO(in, u)) return false;
+    }
+    return true;
+}
+
+// Append-only file of pruned block bodies, indexed by height. Heights must increase;
+// skipped heights are simply not contained.
+class BlockArchive {
+public:
+    std::string path;
+
+    explicit BlockArchive(const std::string& path) : path(path), out(path, std::ios::out | std::ios::trunc) {}
+
+    bool append(const Block& block) {
+        if (!out) return false;
+        if (offsets.empty()) first_height = block.height;
+        if (block.height < first_height + (int)offsets.size()) return false;
+        std::streamoff offset = out.tellp();
+        writeBlock(out, block);
+        out.flush();
+        if (!out) return false;
+        offsets.resize(block.height - first_height, -1);
+        offsets.push_back(offset);
+        return true;
+    }
+
+    bool contains(int height) const {
+        return height >= first_height && height < first_height + (int)offsets.size() && offsets[height - first_height] >= 0;
+    }
+
+    bool load(int height, Block& block) const {
+        if (!contains(height)) return false;
+        std::ifstream in(path);
+        in.seekg(offsets[height - first_height]);
+        return readBlock(in, block) && block.height == height;
+    }
+
+private:
+    std::ofstream out;
+    std::vector<std::streamoff> offsets; // -1 for skipped heights
+    int first_height = 1;
+};
+
+// Keeps full bodies for the newest keep_last blocks; older ones shrink to their header
+// and summary, optionally spilling the body to an archive first. A body the archive
+// cannot take is kept and pruning stops there; error says why until a call gets past it.
+class BlockPruner {
+public:
+    size_t keep_last;
+    BlockArchive* archive;
+    std::string error; // why the last prune() stopped early, empty once it catches up
+
+    explicit BlockPruner(size_t keep_last, BlockArchive* archive = nullptr) : keep_last(keep_last), archive(archive) {}
+
+    size_t prune(std::vector<Block>& blockchain) {
+        size_t count = 0;
+        while (blockchain.size() > next && blockchain.size() - next > keep_last) {
+            Block& block = blockchain[next++];
+            if (block.pruned) continue;
+            if (archive && !archive->append(block)) {
+                --next;
+                error = "Could not archive block #" + std::to_string(block.height) + " to " + archive->path;
+                return count;
+            }
+            std::vector<Transaction>().swap(block.transactions);
+            block.pruned = true;
+            ++count;
+        }
+        error.clear();
+        return count;
+    }
+
+private:
+    size_t next = 0; // blocks below this index are already pruned
+};
@@ -2,7 +2,12 @@
 #include <vector>
 #include <cmath>
 #include <functional>
-#include "mining.cpp"
+#include "miner.cpp"
+#include "batching.cpp"
+#include "reindex.cpp"
+#include "rescan.cpp"
+#include <chrono>
+#include <filesystem>
 #include "utils.hpp"
 
 #define ASSERT_TRUE(condition, msg) \
@@ -282,12 +287,364 @@ bool test_unconfirmed_chain() {
     return true;
 }
 
+bool test_background_mining() {
+    std::cout << "Test 11: Background Mining with Template Refresh... ";
+    TestState state;
+    BackgroundMiner miner(state.mempool, state.manager, state.blockchain);
+    miner.difficulty = 1000000000000ULL; // effectively never finds a block until lowered
+
+    auto waitFor = [&](MinerEventType type, MinerEvent& out) {
+        for (int i = 0; i < 400; ++i) {
+            for (auto& ev : miner.pollEvents()) {
+                if (ev.type == type) { out = ev; return true; }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return false;
+    };
+
+    miner.start("Hasher");
+    Transaction tx1("Alice", {{"Alice", "Bob", 10.0}}, state.manager.getAllUTXOofOwner("Alice"));
+    auto res1 = miner.submit(tx1);
+    ASSERT_TRUE(res1.first, "First TX should be admitted while mining");
+
+    MinerEvent ev;
+    ASSERT_TRUE(waitFor(MinerEventType::TemplateRefreshed, ev), "Template should refresh after first TX");
+
+    Transaction tx2("Bob", {{"Bob", "Charlie", 5.0}}, state.manager.getAllUTXOofOwner("Bob"));
+    auto res2 = miner.submit(tx2);
+    ASSERT_TRUE(res2.first, "Second TX should be admitted while mining");
+    ASSERT_TRUE(waitFor(MinerEventType::TemplateRefreshed, ev), "Template should refresh after second TX");
+    ASSERT_EQ((double)ev.tx_count, 2.0, "Refreshed template should hold both TXs");
+
+    miner.difficulty = 1;
+    ASSERT_TRUE(waitFor(MinerEventType::BlockFound, ev), "Block should be found once difficulty drops");
+    miner.stop();
+
+    ASSERT_EQ((double)ev.tx_count, 2.0, "Mined block should contain both TXs");
+    ASSERT_EQ((double)state.blockchain.size(), 1.0, "Blockchain height should be 1");
+    ASSERT_EQ((double)state.mempool.transactions.size(), 0.0, "Mempool should be empty");
+    ASSERT_EQ(state.manager.getBalance("Hasher"), 0.002, "Miner didn't receive correct fees");
+
+    // A block mined elsewhere makes the running template stale; the event describes the old template
+    miner.difficulty = 1000000000000ULL;
+    miner.start("Hasher");
+    Transaction tx3("Charlie", {{"Charlie", "Alice", 1.0}}, state.manager.getAllUTXOofOwner("Charlie"));
+    ASSERT_TRUE(miner.submit(tx3).first, "Third TX should be admitted while mining");
+    ASSERT_TRUE(waitFor(MinerEventType::TemplateRefreshed, ev), "Template should refresh after third TX");
+    {
+        std::lock_guard<std::mutex> lock(miner.state_mutex);
+        mine_block("Other", state.mempool, state.manager, state.blockchain);
+        miner.notifyNewTip();
+    }
+    ASSERT_TRUE(waitFor(MinerEventType::TemplateStale, ev), "Template should go stale on a new tip");
+    miner.stop();
+    ASSERT_EQ((double)ev.height, 2.0, "Stale event should carry the old template's height");
+    ASSERT_EQ((double)ev.tx_count, 1.0, "Stale event should carry the old template's tx count");
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
+bool test_chained_unconfirmed_spends() {
+    std::cout << "Test 12: Chained Unconfirmed Spends... ";
+    TestState state;
+    CoinView view(state.manager, state.mempool);
+
+    // Alice -> Bob 10, Bob -> Charlie 35 (needs Bob's pending 10), Charlie -> Alice 50 (needs pending 35)
+    Transaction tx1("Alice", {{"Alice", "Bob", 10.0}}, view.getAllUTXOofOwner("Alice"));
+    ASSERT_TRUE(state.mempool.add_transaction(tx1, state.manager).first, "TX1 should be admitted");
+
+    ASSERT_EQ(view.getBalance("Bob"), 40.0, "Bob's view balance should include the pending 10 BTC");
+    Transaction tx2("Bob", {{"Bob", "Charlie", 35.0}}, view.getAllUTXOofOwner("Bob"));
+    ASSERT_TRUE(tx2.is_valid, "TX2 should be fundable from the coin view");
+    ASSERT_TRUE(state.mempool.add_transaction(tx2, state.manager).first, "TX2 spending unconfirmed output should be admitted");
+
+    Transaction tx3("Charlie", {{"Charlie", "Alice", 50.0}}, view.getAllUTXOofOwner("Charlie"));
+    ASSERT_TRUE(state.mempool.add_transaction(tx3, state.manager).first, "TX3 spending unconfirmed output should be admitted");
+
+    // The pending 10 BTC output is now spent by TX2 and cannot be spent again
+    Transaction dup("Bob", {{"Bob", "Eve", 1.0}}, {tx1.outputs[0]});
+    ASSERT_FALSE(state.mempool.add_transaction(dup, state.manager).first, "Pending output spent twice must be rejected");
+    ASSERT_EQ(state.manager.getBalance("Bob"), 30.0, "Confirmed balance should ignore pending outputs");
+
+    mine_block("Hasher", state.mempool, state.manager, state.blockchain);
+
+    ASSERT_EQ((double)state.blockchain[0].transactions.size(), 3.0, "All three chained TXs should be mined in one block");
+    ASSERT_EQ((double)state.mempool.transactions.size(), 0.0, "Mempool should be empty");
+    for (auto& out : tx3.outputs) {
+        ASSERT_TRUE(state.manager.exists(out), "Mined outputs should keep their transaction's UTXO ids");
+    }
+    ASSERT_EQ(state.manager.getBalance("Charlie"), 4.998, "Charlie should keep only the change of TX3");
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
+bool test_payment_batching() {
+    std::cout << "Test 13: Payment Batching... ";
+    TestState state;
+    BatchPolicy policy;
+    policy.max_payments = 3;
+    policy.max_age = std::chrono::seconds(30);
+    PaymentBatcher batcher(state.mempool, state.manager, policy);
+    auto t0 = PaymentBatcher::Clock::now();
+
+    std::vector<BatchResult> results;
+    ASSERT_TRUE(batcher.queue({"Alice", "Bob", 1.0}, t0).empty(), "First payment should only be queued");
+    ASSERT_TRUE(batcher.queue({"Alice", "Charlie", 2.0}, t0).empty(), "Second payment should only be queued");
+    ASSERT_TRUE(batcher.queue({"Bob", "Charlie", 4.0}, t0).empty(), "Bob's payment should only be queued");
+    results = batcher.queue({"Bob", "Alice", -1.0}, t0);
+    ASSERT_TRUE(results.size() == 1 && !results[0].success, "Negative payment should be rejected on its own");
+
+    // Third payment from Alice hits the count window
+    results = batcher.queue({"Alice", "Eve", 3.0}, t0);
+    ASSERT_EQ((double)results.size(), 1.0, "Count window should flush Alice");
+    ASSERT_TRUE(results[0].success, "Alice's batch should be admitted");
+    ASSERT_EQ((double)state.mempool.transactions.size(), 1.0, "Three payments should make one mempool entry");
+    ASSERT_EQ((double)state.mempool.transactions[0].outputs.size(), 4.0, "Batch should have 3 payment outputs and 1 change");
+    ASSERT_EQ(state.mempool.transactions[0].fee, 0.001, "Batch should spend a single input");
+
+    ASSERT_TRUE(batcher.poll(t0 + std::chrono::seconds(10)).empty(), "Bob's batch is not due yet");
+    results = batcher.poll(t0 + std::chrono::seconds(30));
+    ASSERT_EQ((double)results.size(), 1.0, "Time window should flush Bob");
+    ASSERT_TRUE(results[0].success, "Bob's batch should be admitted");
+
+    // Charlie cannot cover 100 BTC even alone, so only that payment is dropped
+    batcher.queue({"Charlie", "Alice", 100.0}, t0);
+    batcher.queue({"Charlie", "Eve", 5.0}, t0);
+    results = batcher.flushAll();
+    ASSERT_TRUE(results[0].success, "Fundable payments should still be sent");
+    ASSERT_EQ((double)results[0].payments, 1.0, "Only the 5 BTC payment should be batched");
+    ASSERT_EQ((double)results[0].rejected, 1.0, "The 100 BTC payment should be rejected");
+
+    ASSERT_EQ((double)batcher.pendingPayments(), 0.0, "Queue should be empty");
+    ASSERT_EQ((double)batcher.metrics.payments_batched, 5.0, "5 payments should be batched");
+    ASSERT_EQ((double)batcher.metrics.payments_failed, 2.0, "2 payments should fail");
+    ASSERT_EQ((double)batcher.metrics.transactions_emitted, 3.0, "3 transactions should be emitted");
+    ASSERT_EQ((double)batcher.metrics.transactionsSaved(), 2.0, "Batching should save 2 transactions");
+    // Bob's batch spends the pending 1 BTC from Alice plus the genesis 30 BTC, and Charlie's spends
+    // the pending 2 and 4 BTC: 5 inputs for 5 payments, so no fee saving is guaranteed
+    ASSERT_EQ((double)batcher.metrics.inputs_used, 5.0, "Batches should use 5 inputs in total");
+    ASSERT_EQ(batcher.metrics.feesSaved(), 0.0, "5 inputs for 5 payments saves no guaranteed fee");
+
+    // Charlie (20 BTC) can fund either 12 BTC payment alone but not both together
+    TestState fresh;
+    BatchPolicy loose;
+    loose.max_payments = 100;
+    PaymentBatcher deferring(fresh.mempool, fresh.manager, loose);
+    deferring.queue({"Charlie", "Alice", 12.0}, t0);
+    deferring.queue({"Charlie", "Bob", 12.0}, t0);
+    results = deferring.flushAll();
+    ASSERT_TRUE(results[0].success, "First 12 BTC payment should be sent");
+    ASSERT_EQ((double)results[0].deferred, 1.0, "Second 12 BTC payment should be re-queued");
+    ASSERT_EQ((double)deferring.pendingPayments(), 1.0, "Deferred payment should stay queued");
+    results = deferring.flushAll();
+    ASSERT_EQ((double)results[0].rejected, 1.0, "Deferred payment exceeds the remaining 7.999 BTC and is dropped");
+
+    // The ticker fires the age window without any further calls
+    BatchPolicy instant;
+    instant.max_age = std::chrono::seconds(0);
+    PaymentBatcher timed(fresh.mempool, fresh.manager, instant);
+    std::mutex stateMutex;
+    BatchTicker ticker(timed, stateMutex, std::chrono::milliseconds(5));
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        timed.queue({"Bob", "Eve", 1.0});
+    }
+    bool flushed = false;
+    for (int i = 0; i < 400 && !flushed; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::lock_guard<std::mutex> lock(stateMutex);
+        for (auto& r : ticker.drain()) flushed = flushed || r.success;
+    }
+    ASSERT_TRUE(flushed, "Ticker should flush the aged payment");
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
+bool test_block_pruning() {
+    std::cout << "Test 14: Block Pruning with Archive... ";
+    TestState state;
+    std::string path = (std::filesystem::temp_directory_path() / "utxo_sim_test_blocks.archive").string();
+    BlockArchive archive(path);
+    BlockPruner pruner(2, &archive);
+
+    std::vector<std::string> commitments;
+    for (int i = 0; i < 5; ++i) {
+        Transaction tx("Alice", {{"Alice", "Bob", 1.0}}, state.manager.getAllUTXOofOwner("Alice"));
+        state.mempool.add_transaction(tx, state.manager);
+        mine_block("Hasher", state.mempool, state.manager, state.blockchain, &pruner);
+        commitments.push_back(state.blockchain.back().commitment);
+    }
+
+    ASSERT_EQ((double)state.blockchain.size(), 5.0, "Blockchain height should be 5");
+    for (int i = 0; i < 5; ++i) {
+        const Block& block = state.blockchain[i];
+        bool shouldPrune = i < 3;
+        double bodySize = shouldPrune ? 0.0 : 1.0;
+        ASSERT_TRUE(block.pruned == shouldPrune, "Only blocks older than the last 2 should be pruned");
+        ASSERT_EQ((double)block.transactions.size(), bodySize, "Pruned blocks should drop their bodies");
+        ASSERT_EQ((double)block.tx_count, 1.0, "Tx count should survive pruning");
+        ASSERT_TRUE(block.commitment == commitments[i], "Commitment should survive pruning");
+    }
+
+    Block restored;
+    ASSERT_TRUE(archive.load(2, restored), "Pruned block body should be in the archive");
+    ASSERT_TRUE(restored.hash == state.blockchain[1].hash, "Archived block should match the header");
+    ASSERT_TRUE(computeCommitment(restored.transactions) == restored.commitment, "Archived body should match its commitment");
+    ASSERT_FALSE(archive.contains(4), "Unpruned blocks should not be archived");
+
+    // Changes below 1e-6, to input owners, parents and fees must still change the commitment
+    std::vector<Transaction> body = restored.transactions;
+    body[0].outputs[0].value += 1e-9;
+    ASSERT_FALSE(computeCommitment(body) == restored.commitment, "Tiny value change should alter the commitment");
+    body = restored.transactions;
+    body[0].inputs[0].owner = "Mallory";
+    ASSERT_FALSE(computeCommitment(body) == restored.commitment, "Input owner change should alter the commitment");
+    body = restored.transactions;
+    body[0].outputs[0].parent_tx_id = "EVIL";
+    ASSERT_FALSE(computeCommitment(body) == restored.commitment, "Output parent change should alter the commitment");
+    body = restored.transactions;
+    body[0].fee += 1e-9;
+    ASSERT_FALSE(computeCommitment(body) == restored.commitment, "Fee change should alter the commitment");
+
+    // An archive that cannot be written keeps the body and reports why pruning stopped
+    std::vector<Block> chain = state.blockchain;
+    BlockArchive unwritable((std::filesystem::temp_directory_path() / "utxo_sim_no_such_dir" / "blocks.archive").string());
+    BlockPruner stalled(0, &unwritable);
+    ASSERT_EQ((double)stalled.prune(chain), 0.0, "Nothing should be pruned without a working archive");
+    ASSERT_FALSE(chain[3].pruned, "Unarchived body must be kept");
+    ASSERT_TRUE(stalled.error.find("block #4") != std::string::npos, "Pruner should report the block it could not archive");
+
+    // A new pruner skips blocks that were already pruned and archives the rest
+    std::string resumed_path = (std::filesystem::temp_directory_path() / "utxo_sim_test_resumed.archive").string();
+    BlockArchive resumed(resumed_path);
+    BlockPruner catchup(0, &resumed);
+    ASSERT_EQ((double)catchup.prune(chain), 2.0, "Blocks #4 and #5 should be pruned");
+    ASSERT_TRUE(catchup.error.empty(), "Pruner should not report an error once it catches up");
+    ASSERT_TRUE(resumed.contains(4) && resumed.contains(5) && !resumed.contains(3), "Archive should start at the first block it was given");
+    std::filesystem::remove(resumed_path);
+    std::filesystem::remove(path);
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
+bool test_parallel_reindex() {
+    std::cout << "Test 15: Parallel Chain Reindex... ";
+    TestState state;
+    state.manager.generateUTXO("genesis", 3, 5.0, "Dave"); // never spent
+    std::vector<UTXO> genesis = state.manager.getAllUTXOs();
+    std::string path = (std::filesystem::temp_directory_path() / "utxo_sim_test_reindex.archive").string();
+    BlockArchive archive(path);
+    BlockPruner pruner(3, &archive);
+    CoinView view(state.manager, state.mempool);
+
+    const char* names[] = {"Alice", "Bob", "Charlie"};
+    for (int i = 0; i < 12; ++i) {
+        // Two chained payments per block
+        std::string a = names[i % 3], b = names[(i + 1) % 3], c = names[(i + 2) % 3];
+        Transaction tx1(a, {{a, b, 1.0}}, view.getAllUTXOofOwner(a));
+        state.mempool.add_transaction(tx1, state.manager);
+        Transaction tx2(b, {{b, c, 2.0}}, view.getAllUTXOofOwner(b));
+        state.mempool.add_transaction(tx2, state.manager);
+        mine_block("Hasher", state.mempool, state.manager, state.blockchain, &pruner);
+    }
+
+    UTXOManager rebuilt;
+    ReindexStats stats;
+    auto res = reindex_chain(state.blockchain, genesis, rebuilt, &archive, 4, &stats);
+    ASSERT_TRUE(res.first, "Reindex should succeed: " + res.second);
+    ASSERT_EQ((double)stats.blocks, 12.0, "All 12 blocks should be applied");
+    ASSERT_EQ((double)stats.shards, 4.0, "Reindex should use 4 shards");
+    ASSERT_EQ((double)rebuilt.by_id.size(), (double)state.manager.by_id.size(), "Rebuilt set size should match");
+    for (auto const& [id, u] : state.manager.by_id) {
+        ASSERT_TRUE(rebuilt.exists(u), "Rebuilt set should contain every live UTXO");
+    }
+    ASSERT_EQ(rebuilt.getBalance("Hasher"), state.manager.getBalance("Hasher"), "Miner balance should match");
+
+    // Tamper with an unpruned block body
+    std::vector<Block> corrupted = state.blockchain;
+    corrupted.back().transactions[0].outputs[0].value += 1.0;
+    UTXOManager broken;
+    ASSERT_FALSE(reindex_chain(corrupted, genesis, broken, &archive, 4).first, "Tampered block must fail the commitment check");
+
+    // Archived body that disagrees with its resident header
+    corrupted = state.blockchain;
+    corrupted.front().coinbase.value += 1.0;
+    res = reindex_chain(corrupted, genesis, broken, &archive, 4);
+    ASSERT_TRUE(!res.first && res.second.find("does not match its header") != std::string::npos,
+                "Archived coinbase must be checked against the header");
+
+    // Rename a genesis UTXO so its later spend cannot be found by the shard that owns it
+    std::vector<UTXO> renamed = genesis;
+    renamed[0].id += "_renamed";
+    res = reindex_chain(state.blockchain, renamed, broken, &archive, 4);
+    ASSERT_TRUE(!res.first && res.second.rfind("Spent UTXO", 0) == 0, "Shards must reject spends of missing UTXOs");
+
+    // Alter Dave's unspent genesis UTXO: spends and counts still agree, the digest does not
+    std::vector<UTXO> altered = genesis;
+    for (auto& u : altered) {
+        if (u.owner == "Dave") u.parent_tx_id = "EVIL";
+    }
+    res = reindex_chain(state.blockchain, altered, broken, &archive, 4);
+    ASSERT_TRUE(!res.first && res.second.find("digest") != std::string::npos, "Rebuilt state must be checked against the tip digest");
+    ASSERT_TRUE(rebuilt.digest == state.manager.digest, "Rebuilt digest should match the live set");
+    std::filesystem::remove(path);
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
+bool test_filtered_wallet_rescan() {
+    std::cout << "Test 16: Filtered Wallet Rescan... ";
+    TestState state;
+    std::string path = (std::filesystem::temp_directory_path() / "utxo_sim_test_rescan.archive").string();
+    BlockArchive archive(path);
+    BlockPruner pruner(5, &archive);
+
+    for (int i = 1; i <= 40; ++i) {
+        std::string payee = "Bob";
+        std::string sender = "Alice";
+        if (i == 5) payee = "Zed";
+        if (i == 8) sender = "Zed";
+        double amount = (sender == "Zed") ? 0.2 : 0.5;
+        Transaction tx(sender, {{sender, payee, amount}}, state.manager.getAllUTXOofOwner(sender));
+        ASSERT_TRUE(tx.is_valid, "Setup TX should be fundable");
+        ASSERT_TRUE(state.mempool.add_transaction(tx, state.manager).first, "Setup TX should be admitted");
+        mine_block("Hasher", state.mempool, state.manager, state.blockchain, &pruner);
+    }
+
+    RescanResult scan;
+    auto res = rescan_wallet(state.blockchain, {"Zed"}, scan, &archive);
+    ASSERT_TRUE(res.first, "Rescan should succeed");
+    ASSERT_EQ((double)scan.blocks_checked, 40.0, "Every block filter should be checked");
+    ASSERT_TRUE(scan.blocks_matched >= 2, "Blocks #5 and #8 must match the filter");
+    ASSERT_TRUE(scan.blocks_matched <= 5, "Filters should skip almost every other block");
+    ASSERT_EQ((double)(scan.blocks_matched - scan.false_positives), 2.0, "Only blocks #5 and #8 touch Zed");
+    ASSERT_EQ((double)scan.unspent.size(), 1.0, "Zed should be left with the change output");
+    ASSERT_EQ(scan.balance, 0.299, "Zed should have 0.5 - 0.2 - 0.001 left");
+    ASSERT_EQ(scan.balance, state.manager.getBalance("Zed"), "Rescanned balance should match the UTXO set");
+
+    // Without the archive the pruned matches are skipped and reported, not fatal
+    RescanResult partial;
+    res = rescan_wallet(state.blockchain, {"Zed"}, partial);
+    ASSERT_TRUE(res.first, "Rescan without archive should still succeed");
+    ASSERT_EQ((double)partial.skipped.size(), (double)scan.blocks_matched, "Every matching pruned block should be reported");
+    std::filesystem::remove(path);
+
+    std::cout << GREEN << " [PASS]" << RESET << std::endl;
+    return true;
+}
+
 int main() {
     enableEscapeSequences();
     std::cout << BOLD << "\nRUNNING TESTS..." << RESET << "\n--------------------------------------------\n";
     
     int passed = 0;
-    int total = 10;
+    int total = 16;
     
     if(test_basic_valid_transaction()) passed++;
     if(test_multiple_inputs()) passed++;
@@ -299,6 +656,12 @@ int main() {
     if(test_race_attack()) passed++;
     if(test_complete_mining_flow()) passed++;
     if(test_unconfirmed_chain()) passed++;
+    if(test_background_mining()) passed++;
+    if(test_chained_unconfirmed_spends()) passed++;
+    if(test_payment_batching()) passed++;
+    if(test_block_pruning()) passed++;
+    if(test_parallel_reindex()) passed++;
+    if(test_filtered_wallet_rescan()) passed++;
 
     std::cout << "\n--------------------------------------------\n";
     if (passed == total) {
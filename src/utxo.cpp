@@ -1,10 +1,18 @@
 #pragma once
 #include "defs.cpp"
+#include <unordered_map>
 class UTXOManager {
 public:
     std::map<std::string,std::vector<UTXO>> utxo_set;
+    std::unordered_map<std::string,UTXO> by_id; // O(1) index over utxo_set keyed by UTXO id
+    uint64_t digest=0; // XOR of hashUTXO over every UTXO in the set
     void generateUTXO(std::string tx_id,int index,double amount,std::string owner) {
-        utxo_set[tx_id].push_back(UTXO{genUniqueUTXOID(),tx_id,owner,amount});
+        addUTXO(UTXO{genUniqueUTXOID(),tx_id,owner,amount});
+    }
+    void addUTXO(const UTXO& utxo) {
+        utxo_set[utxo.parent_tx_id].push_back(utxo);
+        by_id[utxo.id]=utxo;
+        digest^=hashUTXO(utxo);
     }
     double consumeUTXO(const UTXO& utxo) {
         if (!utxo_set.count(utxo.parent_tx_id)) return 0.0;
@@ -12,6 +20,8 @@ public:
         for (auto it=v.begin();it!=v.end();++it) {
             if (*it==utxo) {
                 double val=it->value;
+                by_id.erase(it->id);
+                digest^=hashUTXO(*it);
                 v.erase(it);
                 if (v.empty()) utxo_set.erase(utxo.parent_tx_id);
                 return val;
@@ -26,14 +36,9 @@ public:
         }
         return balance;
     }
-    bool exists(const UTXO& utxo) {
-        if (!utxo_set.count(utxo.parent_tx_id)) return false;
-        for (int i=0;i<utxo_set[utxo.parent_tx_id].size();i++) {
-            if (utxo_set[utxo.parent_tx_id][i]==utxo) {
-                return true;
-            }
-        }
-        return false;
+    bool exists(const UTXO& utxo) const {
+        auto it=by_id.find(utxo.id);
+        return it!=by_id.end()&&it->second==utxo;
     }
     std::pair<std::string,int64_t> getIndex(const UTXO& utxo) {
         if (!utxo_set.count(utxo.parent_tx_id)) return {};